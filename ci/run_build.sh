@@ -132,6 +132,9 @@ if [[ -n "${ARCH_NATIVE-}" ]]; then
         exit 1
       fi
 
+      echo "Testing $tini reports child startup time"
+      "${tini}" -vvv true | grep -q "from fork to exec"
+
       echo "Testing ${tini} references options that exist"
       {
         ! "$tini" 2>&1
@@ -4,6 +4,15 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -15,6 +24,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <libgen.h>
+#include <limits.h>
 
 #include "tiniConfig.h"
 #include "tiniLicense.h"
@@ -45,6 +55,49 @@
 #define STATUS_MAX 255
 #define STATUS_MIN 0
 
+#define HOOKS_MAX 32
+
+typedef enum {
+   SIGNAL_POLICY_PASS = 0,
+   SIGNAL_POLICY_COALESCE,
+   SIGNAL_POLICY_LIMIT,
+} signal_policy_mode_t;
+
+typedef struct {
+   signal_policy_mode_t mode;
+   long long window_ms;       // Coalesce: minimum interval between two forwarded signals.
+   long long window_end_ms;   // Coalesce: end of the current window, 0 if none is open.
+   bool pending;              // Coalesce: a signal arrived during the window and is owed to the child.
+   long long rate;            // Limit: tokens added per second.
+   long long burst;           // Limit: bucket size, in tokens.
+   long long millitokens;     // Limit: current bucket level, in thousandths of a token.
+   long long refill_ms;       // Limit: last time the bucket was refilled.
+   unsigned long forwarded;
+   unsigned long suppressed;
+} signal_policy_t;
+
+typedef enum {
+   HOOK_PENDING = 0,
+   HOOK_RUNNING,
+   HOOK_DONE,
+} hook_state_t;
+
+typedef struct {
+   char* name;
+   char* deps;                // Comma-separated hook names, or NULL.
+   char* command;
+   unsigned int dep_indices[HOOKS_MAX];
+   unsigned int dep_indices_len;
+   hook_state_t state;
+   pid_t pid;
+   long long start_ms;
+} hook_t;
+
+typedef struct {
+   pid_t pid;
+   pid_t ppid;
+} process_entry_t;
+
 typedef struct {
    sigset_t* const sigmask_ptr;
    struct sigaction* const sigttin_action_ptr;
@@ -91,15 +144,16 @@ static int32_t expect_status[(STATUS_MAX - STATUS_MIN + 1) / 32];
 
 #ifdef PR_SET_CHILD_SUBREAPER
 #define HAS_SUBREAPER 1
-#define OPT_STRING "p:hvwgle:s"
+#define OPT_STRING "p:hvwgdle:r:R:c:P:t:T:k:x:S:I:s"
 #define SUBREAPER_ENV_VAR "TINI_SUBREAPER"
 #else
 #define HAS_SUBREAPER 0
-#define OPT_STRING "p:hvwgle:"
+#define OPT_STRING "p:hvwgdle:r:R:c:P:t:T:k:x:S:I:"
 #endif
 
 #define VERBOSITY_ENV_VAR "TINI_VERBOSITY"
 #define KILL_PROCESS_GROUP_GROUP_ENV_VAR "TINI_KILL_PROCESS_GROUP"
+#define KILL_DESCENDANTS_ENV_VAR "TINI_KILL_DESCENDANTS"
 
 #define TINI_VERSION_STRING "tini version " TINI_VERSION TINI_GIT
 
@@ -109,9 +163,42 @@ static unsigned int subreaper = 0;
 #endif
 static unsigned int parent_death_signal = 0;
 static unsigned int kill_process_group = 0;
+static unsigned int kill_descendants = 0;
+
+#define DESCENDANTS_MAX_PASSES 5
 
 static unsigned int warn_on_reap = 0;
 
+#define RELOAD_DELAY_DEFAULT 5
+#define RELOAD_STOP_SIGNAL SIGTERM
+
+static unsigned int reload_signal = 0;
+static unsigned int reload_delay = RELOAD_DELAY_DEFAULT;
+
+#define MAX_RUNTIME_GRACE_DEFAULT 10
+#define MAX_RUNTIME_EXITCODE_DEFAULT 124
+
+static unsigned int max_runtime = 0;
+static unsigned int max_runtime_signal = SIGTERM;
+static unsigned int max_runtime_grace = MAX_RUNTIME_GRACE_DEFAULT;
+static int max_runtime_exitcode = MAX_RUNTIME_EXITCODE_DEFAULT;
+
+// Socket activation: the child is started on the first connection to
+// activation_port, and stopped after idle_timeout seconds without connections.
+#define ACTIVATION_FD 3
+#define ACTIVATION_BACKLOG 128
+
+static struct in_addr activation_addr = { .s_addr = INADDR_ANY };
+static unsigned int activation_port = 0;
+static unsigned int idle_timeout = 0;
+static int activation_fd = -1;
+static int activation_signal_fd = -1;
+
+static signal_policy_t signal_policies[NSIG];
+
+static hook_t hooks[HOOKS_MAX];
+static unsigned int hooks_len = 0;
+
 static struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
 
 static const char reaper_warning[] = "Tini is not running as PID 1 "
@@ -179,49 +266,166 @@ int isolate_child(void) {
 }
 
 
+long long monotonic_ms(void) {
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now)) {
+		// CLOCK_MONOTONIC is always available on Linux, so this should never happen.
+		PRINT_WARNING("clock_gettime failed: '%s'", strerror(errno));
+		return 0;
+	}
+
+	return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void clamp_timeout(struct timespec* const timeout_ptr, long long const deadline_ms) {
+	/* Shorten the main loop timeout so that we wake up when deadline_ms is
+	 * reached, instead of up to a full timeout later.
+	 */
+	long long remaining_ms = deadline_ms - monotonic_ms();
+	if (remaining_ms < 0) {
+		remaining_ms = 0;
+	}
+
+	if (remaining_ms < (long long) timeout_ptr->tv_sec * 1000 + timeout_ptr->tv_nsec / 1000000) {
+		timeout_ptr->tv_sec = remaining_ms / 1000;
+		timeout_ptr->tv_nsec = (remaining_ms % 1000) * 1000000;
+	}
+}
+
+int pass_activation_socket(int* const report_fd_ptr) {
+	/* Runs in the child: move the listening socket to ACTIVATION_FD, and tell
+	 * the child about it like systemd does (see sd_listen_fds(3)).
+	 */
+	char listen_pid[16];
+
+	if (activation_fd < 0) {
+		return 0;
+	}
+
+	// Don't clobber the pipe we use to report failures to the parent.
+	if (*report_fd_ptr == ACTIVATION_FD) {
+		*report_fd_ptr = fcntl(ACTIVATION_FD, F_DUPFD_CLOEXEC, ACTIVATION_FD + 1);
+		if (*report_fd_ptr < 0) {
+			PRINT_FATAL("Failed to move exec status pipe: %s", strerror(errno));
+			return 1;
+		}
+	}
+
+	if (activation_fd == ACTIVATION_FD) {
+		if (fcntl(ACTIVATION_FD, F_SETFD, 0)) {
+			PRINT_FATAL("Failed to pass activation socket: %s", strerror(errno));
+			return 1;
+		}
+	} else if (dup2(activation_fd, ACTIVATION_FD) < 0) {
+		PRINT_FATAL("Failed to pass activation socket: %s", strerror(errno));
+		return 1;
+	}
+
+	snprintf(listen_pid, sizeof listen_pid, "%i", getpid());
+	if (setenv("LISTEN_FDS", "1", 1) || setenv("LISTEN_PID", listen_pid, 1)) {
+		PRINT_FATAL("Failed to set activation environment: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+int exec_failure_status(const int error) {
+	// Exit with the correct return status for the error that we encountered
+	// See: http://www.tldp.org/LDP/abs/html/exitcodes.html#EXITCODESREF
+	switch (error) {
+		case ENOENT:
+			return 127;
+		case EACCES:
+			return 126;
+		default:
+			return 1;
+	}
+}
+
+void report_spawn_failure(const int report_fd, int error) {
+	// Best effort: if this fails, the parent will find out when reaping us.
+	while (write(report_fd, &error, sizeof error) < 0 && errno == EINTR);
+}
+
 int spawn(const signal_configuration_t* const sigconf_ptr, char* const argv[], int* const child_pid_ptr) {
 	pid_t pid;
+	int report_fds[2];
+	int error;
+	ssize_t report_len;
+	struct timespec fork_ts, exec_ts;
 
 	// TODO: check if tini was a foreground process to begin with (it's not OK to "steal" the foreground!")
 
+	// The child reports failures through this pipe. On success, exec closes the
+	// write end (O_CLOEXEC), so the parent sees EOF.
+	if (pipe2(report_fds, O_CLOEXEC)) {
+		PRINT_FATAL("pipe2 failed: %s", strerror(errno));
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &fork_ts);
 	pid = fork();
 	if (pid < 0) {
 		PRINT_FATAL("fork failed: %s", strerror(errno));
+		close(report_fds[0]);
+		close(report_fds[1]);
 		return 1;
 	} else if (pid == 0) {
+		close(report_fds[0]);
 
 		// Put the child in a process group and make it the foreground process if there is a tty.
-		if (isolate_child()) {
-			return 1;
-		}
-
 		// Restore all signal handlers to the way they were before we touched them.
-		if (restore_signals(sigconf_ptr)) {
-			return 1;
+		// Hand over the activation socket, if any.
+		// These already log what went wrong, so report a zero errno.
+		if (isolate_child() || restore_signals(sigconf_ptr) || pass_activation_socket(&report_fds[1])) {
+			report_spawn_failure(report_fds[1], 0);
+			_exit(1);
 		}
 
 		execvp(argv[0], argv);
 
-		// execvp will only return on an error so make sure that we check the errno
-		// and exit with the correct return status for the error that we encountered
-		// See: http://www.tldp.org/LDP/abs/html/exitcodes.html#EXITCODESREF
-		int status = 1;
-		switch (errno) {
-			case ENOENT:
-				status = 127;
-				break;
-			case EACCES:
-				status = 126;
-				break;
-		}
-		PRINT_FATAL("exec %s failed: %s", argv[0], strerror(errno));
-		return status;
-	} else {
-		// Parent
+		// execvp will only return on an error, let the parent know why.
+		error = errno;
+		report_spawn_failure(report_fds[1], error);
+		_exit(exec_failure_status(error));
+	}
+
+	// Parent
+	close(report_fds[1]);
+	do {
+		report_len = read(report_fds[0], &error, sizeof error);
+	} while (report_len < 0 && errno == EINTR);
+	clock_gettime(CLOCK_MONOTONIC, &exec_ts);
+	close(report_fds[0]);
+
+	if (report_len == 0) {
 		PRINT_INFO("Spawned child process '%s' with pid '%i'", argv[0], pid);
+		PRINT_DEBUG("Child process with pid '%i' took %lld us from fork to exec", pid,
+				(long long) (exec_ts.tv_sec - fork_ts.tv_sec) * 1000000 + (exec_ts.tv_nsec - fork_ts.tv_nsec) / 1000);
+		*child_pid_ptr = pid;
+		return 0;
+	}
+
+	if (report_len < 0) {
+		// We can't tell whether exec succeeded, so treat it like it did: we'll
+		// find out how the child fared when reaping it.
+		PRINT_WARNING("Failed to read exec status for pid '%i': %s", pid, strerror(errno));
 		*child_pid_ptr = pid;
 		return 0;
 	}
+
+	// The child failed before or during exec, and has exited (or is about to).
+	// Reap it here so that it doesn't show up as a zombie later.
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+
+	if (error == 0) {
+		return 1;
+	}
+
+	PRINT_FATAL("exec %s failed: %s", argv[0], strerror(error));
+	return exec_failure_status(error);
 }
 
 void print_usage(char* const name, FILE* const file) {
@@ -253,7 +457,20 @@ void print_usage(char* const name, FILE* const file) {
 	fprintf(file, "  -v: Generate more verbose output. Repeat up to 3 times.\n");
 	fprintf(file, "  -w: Print a warning when processes are getting reaped.\n");
 	fprintf(file, "  -g: Send signals to the child's process group.\n");
+	fprintf(file, "  -d: Send signals to all of Tini's descendants.\n");
 	fprintf(file, "  -e EXIT_CODE: Remap EXIT_CODE (from 0 to 255) to 0 (can be repeated).\n");
+	fprintf(file, "  -r SIGNAL: Start a new child and stop the old one upon receiving SIGNAL, e.g. \"-r SIGHUP\".\n");
+	fprintf(file, "  -R SECONDS: Wait SECONDS before stopping the old child on reload (default: %d).\n", RELOAD_DELAY_DEFAULT);
+	fprintf(file, "  -c SIGNAL:POLICY: Throttle forwarding of SIGNAL (can be repeated). POLICY is one of:\n");
+	fprintf(file, "       coalesce:MS (forward at most once every MS milliseconds),\n");
+	fprintf(file, "       limit:RATE[:BURST] (forward at most RATE per second, drop the rest), pass.\n");
+	fprintf(file, "  -P NAME[:DEP,...]=COMMAND: Run COMMAND with /bin/sh before the program, after hooks DEP,... (can be repeated).\n");
+	fprintf(file, "  -t SECONDS: Stop the child if it is still running after SECONDS.\n");
+	fprintf(file, "  -T SIGNAL: Signal to stop the child with when -t expires (default: SIGTERM).\n");
+	fprintf(file, "  -k SECONDS: Send SIGKILL if the child is still running SECONDS after being stopped by -t, -I or a reload (default: %d).\n", MAX_RUNTIME_GRACE_DEFAULT);
+	fprintf(file, "  -x EXIT_CODE: Exit with EXIT_CODE when -t expires, regardless of -e (default: %d).\n", MAX_RUNTIME_EXITCODE_DEFAULT);
+	fprintf(file, "  -S [ADDRESS:]PORT: Listen on TCP PORT, and start the program on the first connection (socket on fd %d).\n", ACTIVATION_FD);
+	fprintf(file, "  -I SECONDS: With -S, stop the program after SECONDS without connections, until the next one.\n");
 	fprintf(file, "  -l: Show license and exit.\n");
 #endif
 
@@ -265,6 +482,7 @@ void print_usage(char* const name, FILE* const file) {
 #endif
 	fprintf(file, "  %s: Set the verbosity level (default: %d).\n", VERBOSITY_ENV_VAR, DEFAULT_VERBOSITY);
 	fprintf(file, "  %s: Send signals to the child's process group.\n", KILL_PROCESS_GROUP_GROUP_ENV_VAR);
+	fprintf(file, "  %s: Send signals to all of Tini's descendants.\n", KILL_DESCENDANTS_ENV_VAR);
 
 	fprintf(file, "\n");
 	free(dirc);
@@ -280,13 +498,13 @@ void print_license(FILE* const file) {
     }
 }
 
-int set_pdeathsig(char* const arg) {
+int parse_signal(const char* const arg, unsigned int* const signal_ptr) {
 	size_t i;
 
 	for (i = 0; i < ARRAY_LEN(signal_names); i++) {
 		if (strcmp(signal_names[i].name, arg) == 0) {
 			/* Signals start at value "1" */
-			parent_death_signal = signal_names[i].number;
+			*signal_ptr = signal_names[i].number;
 			return 0;
 		}
 	}
@@ -294,6 +512,69 @@ int set_pdeathsig(char* const arg) {
 	return 1;
 }
 
+int set_pdeathsig(char* const arg) {
+	return parse_signal(arg, &parent_death_signal);
+}
+
+int set_reload_signal(char* const arg) {
+	if (parse_signal(arg, &reload_signal)) {
+		return 1;
+	}
+
+	/* We need to be able to catch the reload signal, and we don't want to
+	 * steal SIGCHLD from the reaping loop.
+	 */
+	if (reload_signal == SIGKILL || reload_signal == SIGSTOP || reload_signal == SIGCHLD) {
+		reload_signal = 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+int parse_long_in_range(const char* const arg, long const min, long const max, long long* const value_ptr) {
+	long value = 0;
+	char* endptr = NULL;
+	value = strtol(arg, &endptr, 10);
+
+	if ((endptr == NULL) || (*endptr != 0) || (endptr == arg)) {
+		return 1;
+	}
+
+	if ((value < min) || (value > max)) {
+		return 1;
+	}
+
+	*value_ptr = value;
+	return 0;
+}
+
+int set_seconds(char* const arg, unsigned int* const seconds_ptr, long const min) {
+	long long seconds = 0;
+
+	if (parse_long_in_range(arg, min, INT_MAX, &seconds)) {
+		return 1;
+	}
+
+	*seconds_ptr = seconds;
+	return 0;
+}
+
+int set_max_runtime_signal(char* const arg) {
+	return parse_signal(arg, &max_runtime_signal);
+}
+
+int set_max_runtime_exitcode(char* const arg) {
+	long long exitcode = 0;
+
+	if (parse_long_in_range(arg, STATUS_MIN, STATUS_MAX, &exitcode)) {
+		return 1;
+	}
+
+	max_runtime_exitcode = exitcode;
+	return 0;
+}
+
 int add_expect_status(char* arg) {
 	long status = 0;
 	char* endptr = NULL;
@@ -312,6 +593,150 @@ int add_expect_status(char* arg) {
 	return 0;
 }
 
+int parse_signal_policy(char* const arg) {
+	unsigned int signum = 0;
+	char* mode = strchr(arg, ':');
+	char* params = NULL;
+	signal_policy_t policy;
+	memset(&policy, 0, sizeof policy);
+
+	if (mode == NULL) {
+		return 1;
+	}
+	*mode++ = '\0';
+
+	if (parse_signal(arg, &signum)) {
+		return 1;
+	}
+
+	/* Termination signals are always delivered right away. SIGKILL and SIGSTOP
+	 * can't be caught, and we don't forward SIGCHLD.
+	 */
+	switch (signum) {
+		case SIGTERM:
+		case SIGINT:
+		case SIGQUIT:
+		case SIGKILL:
+		case SIGSTOP:
+		case SIGCHLD:
+			return 1;
+	}
+
+	params = strchr(mode, ':');
+	if (params != NULL) {
+		*params++ = '\0';
+	}
+
+	if (strcmp(mode, "pass") == 0 && params == NULL) {
+		policy.mode = SIGNAL_POLICY_PASS;
+	} else if (strcmp(mode, "coalesce") == 0 && params != NULL) {
+		policy.mode = SIGNAL_POLICY_COALESCE;
+		if (parse_long_in_range(params, 1, INT_MAX, &policy.window_ms)) {
+			return 1;
+		}
+	} else if (strcmp(mode, "limit") == 0 && params != NULL) {
+		policy.mode = SIGNAL_POLICY_LIMIT;
+		char* burst = strchr(params, ':');
+		if (burst != NULL) {
+			*burst++ = '\0';
+		}
+		if (parse_long_in_range(params, 1, INT_MAX, &policy.rate)) {
+			return 1;
+		}
+		policy.burst = policy.rate;
+		if (burst != NULL && parse_long_in_range(burst, 1, INT_MAX, &policy.burst)) {
+			return 1;
+		}
+		// Start with a full bucket.
+		policy.millitokens = policy.burst * 1000;
+		policy.refill_ms = monotonic_ms();
+	} else {
+		return 1;
+	}
+
+	signal_policies[signum] = policy;
+	return 0;
+}
+
+int add_signal_policy(char* const arg) {
+	int ret;
+	char* const arg_copy = strdup(arg);
+
+	// Parse a copy, so that arg stays intact for error messages.
+	if (arg_copy == NULL) {
+		return 1;
+	}
+	ret = parse_signal_policy(arg_copy);
+	free(arg_copy);
+
+	return ret;
+}
+
+
+int add_hook(char* const arg) {
+	hook_t* hook;
+	char* spec;
+	char* command;
+	char* deps;
+
+	if (hooks_len >= HOOKS_MAX) {
+		return 1;
+	}
+
+	spec = strdup(arg);
+	if (spec == NULL) {
+		return 1;
+	}
+
+	command = strchr(spec, '=');
+	if (command == NULL || command == spec || *(command + 1) == '\0') {
+		free(spec);
+		return 1;
+	}
+	*command++ = '\0';
+
+	deps = strchr(spec, ':');
+	if (deps != NULL) {
+		*deps++ = '\0';
+	}
+
+	hook = &hooks[hooks_len++];
+	hook->name = spec;
+	hook->deps = deps;
+	hook->command = command;
+	return 0;
+}
+
+int set_activation_address(char* const arg) {
+	long long port = 0;
+	char* address = strdup(arg);
+	char* port_str;
+
+	if (address == NULL) {
+		return 1;
+	}
+
+	port_str = strrchr(address, ':');
+	if (port_str == NULL) {
+		port_str = address;
+	} else {
+		*port_str++ = '\0';
+		if (inet_pton(AF_INET, address, &activation_addr) != 1) {
+			free(address);
+			return 1;
+		}
+	}
+
+	if (parse_long_in_range(port_str, 1, 65535, &port)) {
+		free(address);
+		return 1;
+	}
+
+	activation_port = port;
+	free(address);
+	return 0;
+}
+
 int parse_args(const int argc, char* const argv[], char* (**child_args_ptr_ptr)[], int* const parse_fail_exitcode_ptr) {
 	char* name = argv[0];
 
@@ -355,6 +780,10 @@ int parse_args(const int argc, char* const argv[], char* (**child_args_ptr_ptr)[
 				kill_process_group++;
 				break;
 
+			case 'd':
+				kill_descendants++;
+				break;
+
 			case 'e':
 				if (add_expect_status(optarg)) {
 					PRINT_FATAL("Not a valid option for -e: %s", optarg);
@@ -363,6 +792,86 @@ int parse_args(const int argc, char* const argv[], char* (**child_args_ptr_ptr)[
 				}
 				break;
 
+			case 'r':
+				if (set_reload_signal(optarg)) {
+					PRINT_FATAL("Not a valid option for -r: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'R':
+				if (set_seconds(optarg, &reload_delay, 0)) {
+					PRINT_FATAL("Not a valid option for -R: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'c':
+				if (add_signal_policy(optarg)) {
+					PRINT_FATAL("Not a valid option for -c: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'P':
+				if (add_hook(optarg)) {
+					PRINT_FATAL("Not a valid option for -P: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 't':
+				if (set_seconds(optarg, &max_runtime, 1)) {
+					PRINT_FATAL("Not a valid option for -t: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'T':
+				if (set_max_runtime_signal(optarg)) {
+					PRINT_FATAL("Not a valid option for -T: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'k':
+				if (set_seconds(optarg, &max_runtime_grace, 0)) {
+					PRINT_FATAL("Not a valid option for -k: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'x':
+				if (set_max_runtime_exitcode(optarg)) {
+					PRINT_FATAL("Not a valid option for -x: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'S':
+				if (set_activation_address(optarg)) {
+					PRINT_FATAL("Not a valid option for -S: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
+			case 'I':
+				if (set_seconds(optarg, &idle_timeout, 1)) {
+					PRINT_FATAL("Not a valid option for -I: %s", optarg);
+					*parse_fail_exitcode_ptr = 1;
+					return 1;
+				}
+				break;
+
 			case 'l':
 				print_license(stdout);
 				*parse_fail_exitcode_ptr = 0;
@@ -376,6 +885,12 @@ int parse_args(const int argc, char* const argv[], char* (**child_args_ptr_ptr)[
 				return 1;
 		}
 	}
+
+	if (idle_timeout && !activation_port) {
+		PRINT_FATAL("-I requires -S");
+		*parse_fail_exitcode_ptr = 1;
+		return 1;
+	}
 #endif
 
 	*child_args_ptr_ptr = calloc(argc-optind+1, sizeof(char*));
@@ -410,6 +925,10 @@ int parse_env(void) {
 		kill_process_group++;
 	}
 
+	if (getenv(KILL_DESCENDANTS_ENV_VAR) != NULL) {
+		kill_descendants++;
+	}
+
 	char* env_verbosity = getenv(VERBOSITY_ENV_VAR);
 	if (env_verbosity != NULL) {
 		verbosity = atoi(env_verbosity);
@@ -505,38 +1024,355 @@ int configure_signals(sigset_t* const parent_sigset_ptr, const signal_configurat
 	return 0;
 }
 
-int wait_and_forward_signal(sigset_t const* const parent_sigset_ptr, pid_t const child_pid) {
-	siginfo_t sig;
-
-	if (sigtimedwait(parent_sigset_ptr, &sig, &ts) == -1) {
-		switch (errno) {
-			case EAGAIN:
-				break;
-			case EINTR:
-				break;
-			default:
-				PRINT_FATAL("Unexpected error in sigtimedwait: '%s'", strerror(errno));
-				return 1;
+int forward_signal(pid_t const pid, int const signum) {
+	if (kill(kill_process_group ? -pid : pid, signum)) {
+		if (errno == ESRCH) {
+			PRINT_WARNING("Child was dead when forwarding signal");
+		} else {
+			PRINT_FATAL("Unexpected error when forwarding signal: '%s'", strerror(errno));
+			return 1;
 		}
-	} else {
-		/* There is a signal to handle here */
-		switch (sig.si_signo) {
-			case SIGCHLD:
-				/* Special-cased, as we don't forward SIGCHLD. Instead, we'll
+	}
+
+	return 0;
+}
+
+int list_processes(process_entry_t** const entries_ptr, size_t* const len_ptr) {
+	/* Read the pid and parent pid of every process in /proc. Processes may
+	 * come and go while we do this, so missing files aren't an error.
+	 */
+	DIR* proc_dir;
+	struct dirent* dir_entry;
+	char path[64];
+	char stat[512];
+	size_t capacity = 0;
+	process_entry_t* entries = NULL;
+
+	*len_ptr = 0;
+
+	proc_dir = opendir("/proc");
+	if (proc_dir == NULL) {
+		PRINT_FATAL("Failed to open /proc: '%s'", strerror(errno));
+		return 1;
+	}
+
+	while ((dir_entry = readdir(proc_dir)) != NULL) {
+		char* endptr = NULL;
+		long pid = strtol(dir_entry->d_name, &endptr, 10);
+		if (*endptr != '\0' || pid <= 0) {
+			continue;
+		}
+
+		snprintf(path, sizeof path, "%ld/stat", pid);
+		int stat_fd = openat(dirfd(proc_dir), path, O_RDONLY | O_CLOEXEC);
+		if (stat_fd < 0) {
+			continue;
+		}
+		ssize_t stat_len = read(stat_fd, stat, sizeof stat - 1);
+		close(stat_fd);
+		if (stat_len <= 0) {
+			continue;
+		}
+		stat[stat_len] = '\0';
+
+		// The command name may contain anything, including spaces and
+		// parentheses, so look for the fields after the last ')'.
+		int ppid;
+		char* fields = strrchr(stat, ')');
+		if (fields == NULL || sscanf(fields, ") %*c %d", &ppid) != 1) {
+			continue;
+		}
+
+		if (*len_ptr == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			process_entry_t* const new_entries = realloc(entries, capacity * sizeof *entries);
+			if (new_entries == NULL) {
+				PRINT_FATAL("Failed to allocate memory for process list: '%s'", strerror(errno));
+				free(entries);
+				closedir(proc_dir);
+				return 1;
+			}
+			entries = new_entries;
+		}
+
+		entries[*len_ptr].pid = pid;
+		entries[*len_ptr].ppid = ppid;
+		(*len_ptr)++;
+	}
+
+	closedir(proc_dir);
+	*entries_ptr = entries;
+	return 0;
+}
+
+int compare_ppids(const void* const a, const void* const b) {
+	const pid_t ppid_a = ((const process_entry_t*) a)->ppid;
+	const pid_t ppid_b = ((const process_entry_t*) b)->ppid;
+	return (ppid_a > ppid_b) - (ppid_a < ppid_b);
+}
+
+int compare_pids(const void* const a, const void* const b) {
+	const pid_t pid_a = *(const pid_t*) a;
+	const pid_t pid_b = *(const pid_t*) b;
+	return (pid_a > pid_b) - (pid_a < pid_b);
+}
+
+int signal_descendants(int const signum) {
+	/* Walk the process tree from /proc, and signal everything below us. Our
+	 * descendants may fork while we do this, so walk again until a pass finds
+	 * nothing new, so that children of processes we just signaled aren't missed.
+	 */
+	process_entry_t* entries = NULL;
+	pid_t* queue = NULL;
+	pid_t* signaled = NULL;
+	size_t entries_len, queue_len, queue_head, signaled_len = 0, new_len, lo, hi, mid;
+	unsigned int pass, passes = 0;
+	int ret = 0;
+	struct timespec start_ts, end_ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+
+	for (pass = 0; pass < DESCENDANTS_MAX_PASSES; pass++) {
+		if (list_processes(&entries, &entries_len)) {
+			ret = 1;
+			break;
+		}
+		passes++;
+
+		// Sort by parent so that we can find a process' children with a binary search.
+		qsort(entries, entries_len, sizeof *entries, compare_ppids);
+
+		pid_t* const new_queue = realloc(queue, (entries_len + 1) * sizeof *queue);
+		pid_t* const new_signaled = realloc(signaled, (signaled_len + entries_len + 1) * sizeof *signaled);
+		if (new_queue != NULL) {
+			queue = new_queue;
+		}
+		if (new_signaled != NULL) {
+			signaled = new_signaled;
+		}
+		if (new_queue == NULL || new_signaled == NULL) {
+			PRINT_FATAL("Failed to allocate memory for process tree: '%s'", strerror(errno));
+			free(entries);
+			ret = 1;
+			break;
+		}
+
+		new_len = 0;
+		queue_len = 0;
+		queue[queue_len++] = getpid();
+		for (queue_head = 0; queue_head < queue_len; queue_head++) {
+			lo = 0;
+			hi = entries_len;
+			while (lo < hi) {
+				mid = lo + (hi - lo) / 2;
+				if (entries[mid].ppid < queue[queue_head]) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+
+			for (; lo < entries_len && entries[lo].ppid == queue[queue_head]; lo++) {
+				const pid_t pid = entries[lo].pid;
+				queue[queue_len++] = pid;
+
+				// signaled[0, signaled_len) is sorted; new pids are appended after it.
+				if (bsearch(&pid, signaled, signaled_len, sizeof *signaled, compare_pids) != NULL) {
+					continue;
+				}
+
+				PRINT_TRACE("Passing signal to descendant with pid '%i'", pid);
+				if (kill(pid, signum) && errno != ESRCH) {
+					PRINT_DEBUG("Failed to signal descendant with pid '%i': '%s'", pid, strerror(errno));
+				}
+				signaled[signaled_len + new_len++] = pid;
+			}
+		}
+
+		free(entries);
+		entries = NULL;
+		signaled_len += new_len;
+		qsort(signaled, signaled_len, sizeof *signaled, compare_pids);
+
+		if (new_len == 0) {
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end_ts);
+	PRINT_DEBUG("Passed signal to %zu descendants in %lld us (%u passes)", signaled_len,
+			(long long) (end_ts.tv_sec - start_ts.tv_sec) * 1000000 + (end_ts.tv_nsec - start_ts.tv_nsec) / 1000, passes);
+	if (signaled_len == 0) {
+		PRINT_WARNING("No descendants were alive when forwarding signal");
+	}
+
+	free(queue);
+	free(signaled);
+	return ret;
+}
+
+int forward_signal_to_children(pid_t const child_pid, pid_t const reload_pid, int const signum) {
+	if (kill_descendants) {
+		return signal_descendants(signum);
+	}
+
+	/* While a reload is in progress, both children get the signal. */
+	if (forward_signal(child_pid, signum)) {
+		return 1;
+	}
+	if (reload_pid > 0 && forward_signal(reload_pid, signum)) {
+		return 1;
+	}
+	return 0;
+}
+
+bool signal_policy_allows(int const signum, long long const now) {
+	signal_policy_t* const policy = &signal_policies[signum];
+
+	switch (policy->mode) {
+		case SIGNAL_POLICY_COALESCE:
+			if (policy->window_end_ms == 0 || now >= policy->window_end_ms) {
+				// No window open: forward this one and open a window.
+				policy->window_end_ms = now + policy->window_ms;
+				break;
+			}
+			if (policy->pending) {
+				policy->suppressed++;
+				PRINT_DEBUG("Coalesced signal: '%s'", strsignal(signum));
+			}
+			// Owe the child one signal when the window closes.
+			policy->pending = true;
+			return false;
+
+		case SIGNAL_POLICY_LIMIT: {
+			// No need to look further back than it takes to fill the bucket, and
+			// this keeps the multiplication below from overflowing.
+			long long elapsed_ms = now - policy->refill_ms;
+			const long long fill_ms = (policy->burst * 1000 + policy->rate - 1) / policy->rate;
+			if (elapsed_ms > fill_ms) {
+				elapsed_ms = fill_ms;
+			}
+
+			policy->millitokens += elapsed_ms * policy->rate;
+			if (policy->millitokens > policy->burst * 1000) {
+				policy->millitokens = policy->burst * 1000;
+			}
+			policy->refill_ms = now;
+
+			if (policy->millitokens < 1000) {
+				policy->suppressed++;
+				PRINT_DEBUG("Rate limited signal: '%s'", strsignal(signum));
+				return false;
+			}
+			policy->millitokens -= 1000;
+			break;
+		}
+
+		case SIGNAL_POLICY_PASS:
+			break;
+	}
+
+	policy->forwarded++;
+	return true;
+}
+
+int flush_signal_policies(pid_t const child_pid, pid_t const reload_pid, long long const now) {
+	/* Forward coalesced signals whose window has closed. */
+	int signum;
+	for (signum = 1; signum < NSIG; signum++) {
+		signal_policy_t* const policy = &signal_policies[signum];
+		if (!policy->pending || now < policy->window_end_ms) {
+			continue;
+		}
+
+		PRINT_DEBUG("Passing coalesced signal: '%s'", strsignal(signum));
+		policy->pending = false;
+		policy->window_end_ms = now + policy->window_ms;
+		policy->forwarded++;
+		if (forward_signal_to_children(child_pid, reload_pid, signum)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void clamp_timeout_for_signal_policies(struct timespec* const timeout_ptr) {
+	/* Only pending signals need a wakeup: idle windows are closed lazily. */
+	int signum;
+	for (signum = 1; signum < NSIG; signum++) {
+		if (signal_policies[signum].pending) {
+			clamp_timeout(timeout_ptr, signal_policies[signum].window_end_ms);
+		}
+	}
+}
+
+void report_signal_policies(void) {
+	int signum;
+	for (signum = 1; signum < NSIG; signum++) {
+		signal_policy_t* const policy = &signal_policies[signum];
+		if (policy->mode != SIGNAL_POLICY_PASS) {
+			PRINT_INFO("Signal '%s': forwarded %lu, suppressed %lu", strsignal(signum), policy->forwarded, policy->suppressed);
+		}
+	}
+}
+
+bool is_termination_signal(int const signum) {
+	return signum == SIGTERM || signum == SIGINT || signum == SIGQUIT;
+}
+
+int terminated_exitcode(int const signum) {
+	/* Exit as if the child had been killed by signum, including -e remapping. */
+	int exitcode = (128 + signum) % (STATUS_MAX - STATUS_MIN + 1);
+
+	INT32_BITFIELD_CHECK_BOUNDS(expect_status, exitcode);
+	if (INT32_BITFIELD_TEST(expect_status, exitcode)) {
+		exitcode = 0;
+	}
+	return exitcode;
+}
+
+int wait_and_forward_signal(sigset_t const* const parent_sigset_ptr, struct timespec const* const timeout_ptr, pid_t const child_pid, pid_t const reload_pid, int* const reload_requested_ptr, int* const termination_signal_ptr) {
+	siginfo_t sig;
+
+	if (sigtimedwait(parent_sigset_ptr, &sig, timeout_ptr) == -1) {
+		switch (errno) {
+			case EAGAIN:
+				break;
+			case EINTR:
+				break;
+			default:
+				PRINT_FATAL("Unexpected error in sigtimedwait: '%s'", strerror(errno));
+				return 1;
+		}
+	} else {
+		/* There is a signal to handle here */
+		switch (sig.si_signo) {
+			case SIGCHLD:
+				/* Special-cased, as we don't forward SIGCHLD. Instead, we'll
 				 * fallthrough to reaping processes.
 				 */
 				PRINT_DEBUG("Received SIGCHLD");
 				break;
 			default:
+				if (reload_signal && sig.si_signo == (int) reload_signal) {
+					/* Not forwarded: the main loop will start the new child. */
+					PRINT_DEBUG("Received reload signal: '%s'", strsignal(sig.si_signo));
+					*reload_requested_ptr = 1;
+					break;
+				}
+
+				if (!signal_policy_allows(sig.si_signo, monotonic_ms())) {
+					break;
+				}
+
 				PRINT_DEBUG("Passing signal: '%s'", strsignal(sig.si_signo));
 				/* Forward anything else */
-				if (kill(kill_process_group ? -child_pid : child_pid, sig.si_signo)) {
-					if (errno == ESRCH) {
-						PRINT_WARNING("Child was dead when forwarding signal");
-					} else {
-						PRINT_FATAL("Unexpected error when forwarding signal: '%s'", strerror(errno));
-						return 1;
-					}
+				if (forward_signal_to_children(child_pid, reload_pid, sig.si_signo)) {
+					return 1;
+				}
+				if (is_termination_signal(sig.si_signo)) {
+					*termination_signal_ptr = sig.si_signo;
 				}
 				break;
 		}
@@ -545,7 +1381,7 @@ int wait_and_forward_signal(sigset_t const* const parent_sigset_ptr, pid_t const
 	return 0;
 }
 
-int reap_zombies(const pid_t child_pid, int* const child_exitcode_ptr) {
+int reap_zombies(pid_t* const child_pid_ptr, pid_t* const reload_pid_ptr, pid_t* const outgoing_pid_ptr, int const termination_signal, int* const child_exitcode_ptr) {
 	pid_t current_pid;
 	int current_status;
 
@@ -571,7 +1407,22 @@ int reap_zombies(const pid_t child_pid, int* const child_exitcode_ptr) {
 				 * set the exit_code, which will cause us to exit once we've reaped everyone else.
 				 */
 				PRINT_DEBUG("Reaped child with pid: '%i'", current_pid);
-				if (current_pid == child_pid) {
+				if (*outgoing_pid_ptr > 0 && current_pid == *outgoing_pid_ptr) {
+					/* The instance we replaced on reload is gone. */
+					PRINT_INFO("Previous child with pid '%i' has exited", current_pid);
+					*outgoing_pid_ptr = 0;
+				} else if (*reload_pid_ptr > 0 && current_pid == *reload_pid_ptr) {
+					/* The new child died before it could take over. Keep the old one. */
+					PRINT_WARNING("Reload child with pid '%i' exited before taking over, keeping pid '%i'", current_pid, *child_pid_ptr);
+					*reload_pid_ptr = 0;
+				} else if (*reload_pid_ptr > 0 && current_pid == *child_pid_ptr && !termination_signal) {
+					/* The old child exited on its own during a reload: hand over right away.
+					 * Not if we're being stopped though: then this is the exit we wait for.
+					 */
+					PRINT_INFO("Main child exited during reload, promoting pid '%i'", *reload_pid_ptr);
+					*child_pid_ptr = *reload_pid_ptr;
+					*reload_pid_ptr = 0;
+				} else if (current_pid == *child_pid_ptr) {
 					if (WIFEXITED(current_status)) {
 						/* Our process exited normally. */
 						PRINT_INFO("Main child exited normally (with status '%i')", WEXITSTATUS(current_status));
@@ -611,8 +1462,401 @@ int reap_zombies(const pid_t child_pid, int* const child_exitcode_ptr) {
 }
 
 
+int next_stop_signal(int const signum, long long* const deadline_ptr, unsigned int* const stage_ptr) {
+	/* The first time, ask the child to stop with signum, and give it a grace
+	 * period (ending at *deadline_ptr). The second time, kill it.
+	 */
+	if (*stage_ptr == 0) {
+		*stage_ptr = 1;
+		*deadline_ptr = monotonic_ms() + (long long) max_runtime_grace * 1000;
+		return signum;
+	}
+
+	PRINT_WARNING("Child still running %u seconds after '%s', sending '%s'", max_runtime_grace, strsignal(signum), strsignal(SIGKILL));
+	*stage_ptr = 2;
+	*deadline_ptr = 0;
+	return SIGKILL;
+}
+
+int stop_children(pid_t const child_pid, pid_t const reload_pid, int const signum, long long* const deadline_ptr, unsigned int* const stage_ptr) {
+	return forward_signal_to_children(child_pid, reload_pid, next_stop_signal(signum, deadline_ptr, stage_ptr));
+}
+
+int stop_outgoing_child(pid_t const outgoing_pid, long long* const deadline_ptr, unsigned int* const stage_ptr) {
+	/* Unlike stop_children, this never walks descendants (-d): those include
+	 * the new instance, which must be left alone.
+	 */
+	return forward_signal(outgoing_pid, next_stop_signal(RELOAD_STOP_SIGNAL, deadline_ptr, stage_ptr));
+}
+
+int enforce_max_runtime(pid_t const child_pid, pid_t const reload_pid, long long* const deadline_ptr, unsigned int* const stage_ptr) {
+	/* Called once the max runtime deadline has passed. */
+	if (*stage_ptr == 0) {
+		PRINT_WARNING("Child exceeded max runtime of %u seconds, sending '%s'", max_runtime, strsignal(max_runtime_signal));
+	}
+	return stop_children(child_pid, reload_pid, max_runtime_signal, deadline_ptr, stage_ptr);
+}
+
+int setup_activation(sigset_t const* const parent_sigset_ptr) {
+	struct sockaddr_in addr;
+	int reuse = 1;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr = activation_addr;
+	addr.sin_port = htons(activation_port);
+
+	activation_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (activation_fd < 0) {
+		PRINT_FATAL("Failed to create activation socket: '%s'", strerror(errno));
+		return 1;
+	}
+
+	if (setsockopt(activation_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse)) {
+		PRINT_FATAL("Failed to set SO_REUSEADDR on activation socket: '%s'", strerror(errno));
+		return 1;
+	}
+
+	if (bind(activation_fd, (struct sockaddr*) &addr, sizeof addr) || listen(activation_fd, ACTIVATION_BACKLOG)) {
+		PRINT_FATAL("Failed to listen on port '%u': '%s'", activation_port, strerror(errno));
+		return 1;
+	}
+
+	// While there is no child, we wait for connections and signals together.
+	activation_signal_fd = signalfd(-1, parent_sigset_ptr, SFD_CLOEXEC);
+	if (activation_signal_fd < 0) {
+		PRINT_FATAL("signalfd failed: '%s'", strerror(errno));
+		return 1;
+	}
+
+	PRINT_INFO("Listening on '%s:%u', waiting for a connection to start the child", inet_ntoa(activation_addr), activation_port);
+	return 0;
+}
+
+int wait_for_activation(int* const activation_ready_ptr, int* const exitcode_ptr) {
+	/* Wait until either a connection is pending on the activation socket, or
+	 * we get a signal. Termination signals make us exit, since there is no
+	 * child to pass them to.
+	 */
+	struct pollfd fds[2];
+	struct signalfd_siginfo info;
+
+	fds[0].fd = activation_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = activation_signal_fd;
+	fds[1].events = POLLIN;
+
+	if (poll(fds, ARRAY_LEN(fds), -1) < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		PRINT_FATAL("Unexpected error in poll: '%s'", strerror(errno));
+		return 1;
+	}
+
+	if (fds[0].revents & POLLIN) {
+		PRINT_DEBUG("Connection pending on activation socket");
+		*activation_ready_ptr = 1;
+	}
+
+	if (fds[1].revents & POLLIN) {
+		if (read(activation_signal_fd, &info, sizeof info) != sizeof info) {
+			PRINT_FATAL("Failed to read from signalfd: '%s'", strerror(errno));
+			return 1;
+		}
+
+		switch (info.ssi_signo) {
+			case SIGCHLD:
+				PRINT_DEBUG("Received SIGCHLD");
+				break;
+			case SIGTERM:
+			case SIGINT:
+			case SIGQUIT:
+				PRINT_INFO("No child running, exiting on signal: '%s'", strsignal(info.ssi_signo));
+				*exitcode_ptr = terminated_exitcode(info.ssi_signo);
+				break;
+			default:
+				PRINT_DEBUG("No child running, ignoring signal: '%s'", strsignal(info.ssi_signo));
+				break;
+		}
+	}
+
+	return 0;
+}
+
+bool activation_port_busy(void) {
+	/* Check whether anyone is connected (or about to) to the activation socket.
+	 * Our child accepts the connections, so we look them up in /proc/net/tcp.
+	 * The socket is IPv4, so its connections never show up in /proc/net/tcp6.
+	 */
+	struct pollfd fd = { .fd = activation_fd, .events = POLLIN, .revents = 0 };
+	char line[256];
+	unsigned int local_addr, local_port, state;
+	bool busy = false;
+
+	if (poll(&fd, 1, 0) > 0) {
+		return true;
+	}
+
+	FILE* const table = fopen("/proc/net/tcp", "re");
+	if (table == NULL) {
+		PRINT_DEBUG("Failed to open /proc/net/tcp: '%s'", strerror(errno));
+		return false;
+	}
+
+	while (!busy && fgets(line, sizeof line, table) != NULL) {
+		// Format: "sl: local_address:port rem_address:port st ...", all in hex.
+		// Addresses are printed as the raw (network order) 32-bit value.
+		if (sscanf(line, " %*s %x:%x %*[0-9A-Fa-f]:%*x %x", &local_addr, &local_port, &state) != 3) {
+			continue;
+		}
+
+		if (local_port != activation_port) {
+			continue;
+		}
+
+		if (activation_addr.s_addr != INADDR_ANY && local_addr != activation_addr.s_addr) {
+			continue;
+		}
+
+		// We only sample this every second or so, so recently closed
+		// connections (TIME_WAIT, FIN_WAIT, ...) count too: the kernel times
+		// them out on its own. CLOSE_WAIT (08) doesn't: that's a connection
+		// the client closed and the child forgot about. Neither do CLOSE (07)
+		// and LISTEN (0A).
+		busy = (state != 0x07 && state != 0x08 && state != 0x0A);
+	}
+
+	fclose(table);
+	return busy;
+}
+
+int resolve_hook_deps(void) {
+	unsigned int i, j;
+	char* dep;
+	char* saveptr;
+
+	for (i = 0; i < hooks_len; i++) {
+		if (hooks[i].deps == NULL) {
+			continue;
+		}
+
+		for (dep = strtok_r(hooks[i].deps, ",", &saveptr); dep != NULL; dep = strtok_r(NULL, ",", &saveptr)) {
+			for (j = 0; j < hooks_len; j++) {
+				if (strcmp(hooks[j].name, dep) == 0) {
+					break;
+				}
+			}
+
+			if (j == hooks_len) {
+				PRINT_FATAL("Pre-start hook '%s' depends on unknown hook '%s'", hooks[i].name, dep);
+				return 1;
+			}
+
+			if (hooks[i].dep_indices_len < HOOKS_MAX) {
+				hooks[i].dep_indices[hooks[i].dep_indices_len++] = j;
+			}
+		}
+	}
+
+	return 0;
+}
+
+bool hook_is_ready(const hook_t* const hook) {
+	unsigned int i;
+
+	if (hook->state != HOOK_PENDING) {
+		return false;
+	}
+
+	for (i = 0; i < hook->dep_indices_len; i++) {
+		if (hooks[hook->dep_indices[i]].state != HOOK_DONE) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int hook_exitcode(const int status) {
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		return (128 + WTERMSIG(status)) % (STATUS_MAX - STATUS_MIN + 1);
+	}
+	return 1;
+}
+
+void signal_running_hooks(int const signum) {
+	unsigned int i;
+
+	for (i = 0; i < hooks_len; i++) {
+		if (hooks[i].state == HOOK_RUNNING) {
+			// Hooks may well exit before we get to them, so don't make a fuss.
+			kill(kill_process_group ? -hooks[i].pid : hooks[i].pid, signum);
+		}
+	}
+}
+
+int run_hooks(const signal_configuration_t* const sigconf_ptr, sigset_t const* const parent_sigset_ptr, int* const exitcode_ptr) {
+	/* Run pre-start hooks, starting each one as soon as all its dependencies
+	 * have succeeded. Returns 1 if we must exit instead of starting the child,
+	 * with the exit code in exitcode_ptr: that of the first hook that fails,
+	 * or the one for a termination signal we received meanwhile.
+	 */
+	unsigned int i, running = 0, done = 0;
+	int exitcode = 0;
+	int stop_signal = 0;
+	int status;
+	pid_t current_pid;
+	siginfo_t sig;
+
+	if (resolve_hook_deps()) {
+		*exitcode_ptr = 1;
+		return 1;
+	}
+
+	while (done < hooks_len) {
+		for (i = 0; exitcode == 0 && stop_signal == 0 && i < hooks_len; i++) {
+			if (!hook_is_ready(&hooks[i])) {
+				continue;
+			}
+
+			char* const hook_args[] = { "/bin/sh", "-c", hooks[i].command, NULL };
+			hooks[i].start_ms = monotonic_ms();
+			exitcode = spawn(sigconf_ptr, hook_args, &hooks[i].pid);
+			if (exitcode) {
+				PRINT_FATAL("Failed to start pre-start hook '%s'", hooks[i].name);
+				signal_running_hooks(SIGTERM);
+				break;
+			}
+
+			PRINT_INFO("Started pre-start hook '%s' with pid '%i'", hooks[i].name, hooks[i].pid);
+			hooks[i].state = HOOK_RUNNING;
+			running++;
+		}
+
+		if (running == 0) {
+			if (exitcode == 0 && stop_signal == 0) {
+				PRINT_FATAL("Pre-start hooks have circular dependencies");
+				exitcode = 1;
+			}
+			break;
+		}
+
+		if (sigtimedwait(parent_sigset_ptr, &sig, &ts) == -1) {
+			if (errno != EAGAIN && errno != EINTR) {
+				PRINT_FATAL("Unexpected error in sigtimedwait: '%s'", strerror(errno));
+				*exitcode_ptr = 1;
+				return 1;
+			}
+		} else if (sig.si_signo != SIGCHLD) {
+			if (is_termination_signal(sig.si_signo) && stop_signal == 0) {
+				// Don't start anything else, and in particular not the child.
+				PRINT_INFO("Received '%s' during pre-start hooks, not starting the child", strsignal(sig.si_signo));
+				stop_signal = sig.si_signo;
+			}
+			PRINT_DEBUG("Passing signal to pre-start hooks: '%s'", strsignal(sig.si_signo));
+			signal_running_hooks(sig.si_signo);
+		}
+
+		while ((current_pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (i = 0; i < hooks_len; i++) {
+				if (hooks[i].state == HOOK_RUNNING && hooks[i].pid == current_pid) {
+					break;
+				}
+			}
+
+			if (i == hooks_len) {
+				if (warn_on_reap > 0) {
+					PRINT_WARNING("Reaped zombie process with pid=%i", current_pid);
+				}
+				continue;
+			}
+
+			hooks[i].state = HOOK_DONE;
+			running--;
+			done++;
+
+			if (hook_exitcode(status) == 0) {
+				PRINT_INFO("Pre-start hook '%s' succeeded in %lld ms", hooks[i].name, monotonic_ms() - hooks[i].start_ms);
+			} else if (exitcode == 0) {
+				exitcode = hook_exitcode(status);
+				PRINT_FATAL("Pre-start hook '%s' failed (with status '%i'), aborting", hooks[i].name, exitcode);
+				signal_running_hooks(SIGTERM);
+			}
+		}
+
+		if (current_pid < 0 && errno != ECHILD) {
+			PRINT_FATAL("Error while waiting for pids: '%s'", strerror(errno));
+			*exitcode_ptr = 1;
+			return 1;
+		}
+	}
+
+	if (exitcode != 0) {
+		*exitcode_ptr = exitcode;
+		return 1;
+	}
+
+	if (stop_signal != 0) {
+		*exitcode_ptr = terminated_exitcode(stop_signal);
+		return 1;
+	}
+
+	return 0;
+}
+
+void start_reload(const signal_configuration_t* const sigconf_ptr, char* const argv[], pid_t const child_pid, pid_t const outgoing_pid, pid_t* const reload_pid_ptr, long long* const reload_deadline_ptr) {
+	if (*reload_pid_ptr > 0) {
+		PRINT_WARNING("Reload already in progress (pid '%i'), ignoring reload signal", *reload_pid_ptr);
+		return;
+	}
+	if (outgoing_pid > 0) {
+		PRINT_WARNING("Previous child with pid '%i' is still stopping, ignoring reload signal", outgoing_pid);
+		return;
+	}
+
+	if (spawn(sigconf_ptr, argv, reload_pid_ptr)) {
+		PRINT_WARNING("Failed to start reload child, keeping pid '%i'", child_pid);
+		return;
+	}
+
+	PRINT_INFO("Started reload child with pid '%i', taking over in %u seconds", *reload_pid_ptr, reload_delay);
+	*reload_deadline_ptr = monotonic_ms() + (long long) reload_delay * 1000;
+}
+
+int complete_reload(pid_t* const child_pid_ptr, pid_t* const reload_pid_ptr, pid_t* const outgoing_pid_ptr, long long* const outgoing_deadline_ptr, unsigned int* const outgoing_stage_ptr) {
+	/* The new child survived the overlap period: ask the old one to stop, and
+	 * track the new one as the main child from now on. The old one is tracked
+	 * until it's reaped, and killed if it outlives the grace period.
+	 */
+	PRINT_INFO("Reload child with pid '%i' is taking over, stopping pid '%i'", *reload_pid_ptr, *child_pid_ptr);
+	*outgoing_pid_ptr = *child_pid_ptr;
+	*outgoing_stage_ptr = 0;
+	if (stop_outgoing_child(*outgoing_pid_ptr, outgoing_deadline_ptr, outgoing_stage_ptr)) {
+		return 1;
+	}
+
+	*child_pid_ptr = *reload_pid_ptr;
+	*reload_pid_ptr = 0;
+	return 0;
+}
+
+
 int main(int argc, char *argv[]) {
 	pid_t child_pid;
+	pid_t reload_pid = 0;                // Set while a new child is overlapping with the main one.
+	long long reload_deadline = 0;
+	pid_t outgoing_pid = 0;              // Set while the child replaced on reload is stopping.
+	long long outgoing_deadline = 0;     // When to send it SIGKILL, 0 once sent.
+	unsigned int outgoing_stage = 0;
+	long long max_runtime_deadline = 0;  // 0 when there is no max runtime (anymore).
+	unsigned int max_runtime_stage = 0;  // 0: armed, 1: stop signal sent, 2: SIGKILL sent.
+	long long idle_since = 0;            // Socket activation: last time the child was seen busy.
+	unsigned int idle_stopping = 0;      // Socket activation: 0: running, 1: SIGTERM sent, 2: SIGKILL sent.
+	long long idle_stop_deadline = 0;    // Socket activation: when to send SIGKILL, 0 if not stopping.
+	int termination_signal = 0;          // Set once we've passed on SIGTERM, SIGINT or SIGQUIT.
 
 	// Those are passed to functions to get an exitcode back.
 	int child_exitcode = -1;  // This isn't a valid exitcode, and lets us tell whether the child has exited.
@@ -662,27 +1906,166 @@ int main(int argc, char *argv[]) {
 	/* Are we going to reap zombies properly? If not, warn. */
 	reaper_check();
 
+	/* Run pre-start hooks, if any */
+	int hooks_exitcode = 1;
+	if (run_hooks(&child_sigconf, &parent_sigset, &hooks_exitcode)) {
+		return hooks_exitcode;
+	}
+
 	/* Go on */
-	int spawn_ret = spawn(&child_sigconf, *child_args_ptr, &child_pid);
-	if (spawn_ret) {
-		return spawn_ret;
+	if (activation_port) {
+		// The child will be started on the first connection.
+		if (setup_activation(&parent_sigset)) {
+			return 1;
+		}
+		child_pid = 0;
+	} else {
+		int spawn_ret = spawn(&child_sigconf, *child_args_ptr, &child_pid);
+		if (spawn_ret) {
+			return spawn_ret;
+		}
+		if (max_runtime) {
+			max_runtime_deadline = monotonic_ms() + (long long) max_runtime * 1000;
+		}
+	}
+	if (!reload_signal && !activation_port) {
+		// Otherwise, we keep the arguments around to spawn the child again.
+		free(child_args_ptr);
 	}
-	free(child_args_ptr);
 
 	while (1) {
+		if (child_pid == 0) {
+			/* Socket activation: no child is running, wait for a connection */
+			int activation_ready = 0;
+			if (wait_for_activation(&activation_ready, &child_exitcode)) {
+				return 1;
+			}
+
+			if (reap_zombies(&child_pid, &reload_pid, &outgoing_pid, termination_signal, &child_exitcode)) {
+				return 1;
+			}
+
+			if (child_exitcode != -1) {
+				PRINT_TRACE("Exiting: received signal while no child was running");
+				return child_exitcode;
+			}
+
+			if (activation_ready) {
+				int spawn_ret = spawn(&child_sigconf, *child_args_ptr, &child_pid);
+				if (spawn_ret) {
+					return spawn_ret;
+				}
+				idle_since = monotonic_ms();
+				if (max_runtime) {
+					max_runtime_deadline = monotonic_ms() + (long long) max_runtime * 1000;
+				}
+			}
+			continue;
+		}
+
+
+		struct timespec timeout = ts;
+		int reload_requested = 0;
+
+		if (reload_pid > 0) {
+			clamp_timeout(&timeout, reload_deadline);
+		}
+		if (outgoing_pid > 0 && outgoing_deadline) {
+			clamp_timeout(&timeout, outgoing_deadline);
+		}
+		if (max_runtime_deadline) {
+			clamp_timeout(&timeout, max_runtime_deadline);
+		}
+		if (idle_stop_deadline) {
+			clamp_timeout(&timeout, idle_stop_deadline);
+		}
+		clamp_timeout_for_signal_policies(&timeout);
+
 		/* Wait for one signal, and forward it */
-		if (wait_and_forward_signal(&parent_sigset, child_pid)) {
+		if (wait_and_forward_signal(&parent_sigset, &timeout, child_pid, reload_pid, &reload_requested, &termination_signal)) {
+			return 1;
+		}
+
+		if (flush_signal_policies(child_pid, reload_pid, monotonic_ms())) {
 			return 1;
 		}
 
+		if (reload_requested) {
+			if (idle_stopping || max_runtime_stage > 0 || termination_signal) {
+				// A new instance would only get stopped along with the old one.
+				PRINT_WARNING("Child is being stopped, ignoring reload signal");
+			} else {
+				start_reload(&child_sigconf, *child_args_ptr, child_pid, outgoing_pid, &reload_pid, &reload_deadline);
+			}
+		}
+
 		/* Now, reap zombies */
-		if (reap_zombies(child_pid, &child_exitcode)) {
+		if (reap_zombies(&child_pid, &reload_pid, &outgoing_pid, termination_signal, &child_exitcode)) {
 			return 1;
 		}
 
+		if (reload_pid > 0 && monotonic_ms() >= reload_deadline) {
+			if (complete_reload(&child_pid, &reload_pid, &outgoing_pid, &outgoing_deadline, &outgoing_stage)) {
+				return 1;
+			}
+		}
+
+		if (outgoing_pid > 0 && outgoing_deadline && monotonic_ms() >= outgoing_deadline) {
+			if (stop_outgoing_child(outgoing_pid, &outgoing_deadline, &outgoing_stage)) {
+				return 1;
+			}
+		}
+
+		if (child_exitcode != -1 && outgoing_pid > 0) {
+			// Don't leave the previous child behind: it'll be killed after the grace period.
+			PRINT_TRACE("Child has exited, waiting for previous child with pid '%i'", outgoing_pid);
+			continue;
+		}
+
+		if (child_exitcode != -1 && idle_stopping && max_runtime_stage == 0 && termination_signal == 0) {
+			// We stopped the child ourselves: wait for the next connection.
+			PRINT_INFO("Idle child has exited, waiting for a connection to start it again");
+			child_pid = 0;
+			child_exitcode = -1;
+			idle_stopping = 0;
+			idle_stop_deadline = 0;
+			max_runtime_deadline = 0;
+			continue;
+		}
+
 		if (child_exitcode != -1) {
+			report_signal_policies();
+			if (max_runtime_stage > 0) {
+				// Not subject to -e: this must be distinguishable from a normal exit.
+				PRINT_TRACE("Exiting: child has exited after exceeding max runtime");
+				return max_runtime_exitcode;
+			}
 			PRINT_TRACE("Exiting: child has exited");
 			return child_exitcode;
 		}
+
+		if (max_runtime_deadline && monotonic_ms() >= max_runtime_deadline) {
+			if (enforce_max_runtime(child_pid, reload_pid, &max_runtime_deadline, &max_runtime_stage)) {
+				return 1;
+			}
+		}
+
+		/* With socket activation, stop the child once it has been idle long
+		 * enough. This piggybacks on the main loop's regular wakeups.
+		 */
+		if (idle_timeout && activation_port && !idle_stopping) {
+			if (activation_port_busy()) {
+				idle_since = monotonic_ms();
+			} else if (monotonic_ms() - idle_since >= (long long) idle_timeout * 1000) {
+				PRINT_INFO("No connections for %u seconds, stopping child", idle_timeout);
+				if (stop_children(child_pid, reload_pid, SIGTERM, &idle_stop_deadline, &idle_stopping)) {
+					return 1;
+				}
+			}
+		} else if (idle_stop_deadline && monotonic_ms() >= idle_stop_deadline) {
+			if (stop_children(child_pid, reload_pid, SIGTERM, &idle_stop_deadline, &idle_stopping)) {
+				return 1;
+			}
+		}
 	}
 }
@@ -0,0 +1,30 @@
+#!/usr/bin/env python
+import os
+import signal
+import socket
+import sys
+import time
+
+
+def main():
+    # Optionally, take a while to exit on SIGTERM.
+    if len(sys.argv) > 1:
+        stop_delay = float(sys.argv[1])
+
+        def slow_exit(signum, frame):
+            time.sleep(stop_delay)
+            sys.exit(0)
+
+        signal.signal(signal.SIGTERM, slow_exit)
+
+    # Tini passes the listening socket as fd 3, like systemd does.
+    assert os.environ["LISTEN_FDS"] == "1"
+    assert os.environ["LISTEN_PID"] == str(os.getpid())
+    s = socket.socket(fileno=3)
+    while True:
+        conn, _ = s.accept()
+        conn.sendall(str(os.getpid()).encode())
+        conn.close()
+
+if __name__ == "__main__":
+    main()
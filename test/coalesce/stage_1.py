@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+import signal
+import sys
+import time
+
+received = []
+
+
+def main():
+    signal.signal(signal.SIGUSR1, lambda signum, frame: received.append(signum))
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(len(received)))
+    while True:
+        time.sleep(0.1)
+
+if __name__ == "__main__":
+    main()
@@ -10,6 +10,7 @@ import bitmap
 import re
 import itertools
 import tempfile
+import socket
 
 DEVNULL = open(os.devnull, "wb")
 
@@ -180,6 +181,232 @@ def main():
     p.send_signal(signal.SIGUSR1)
     busy_wait(lambda: p.poll() is not None, 10)
 
+    # Run the descendants test
+    # Like the process group test, but the grand-child calls setsid, so only
+    # sending the signal to all descendants reaches it.
+    if not args_disabled:
+        print("Running descendants test (arguments)")
+        p = subprocess.Popen(
+            [tini, "-d", os.path.join(src, "test", "descendants", "stage_1.py")],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            universal_newlines=True,
+        )
+
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) == 2, 10)
+        p.send_signal(signal.SIGUSR1)
+        busy_wait(lambda: p.poll() is not None, 10)
+
+    print("Running descendants test (environment variable)")
+    p = subprocess.Popen(
+        [tini, os.path.join(src, "test", "descendants", "stage_1.py")],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        env=dict(os.environ, TINI_KILL_DESCENDANTS="1"),
+        universal_newlines=True,
+    )
+
+    busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) == 2, 10)
+    p.send_signal(signal.SIGUSR1)
+    busy_wait(lambda: p.poll() is not None, 10)
+
+    # Run the reload test
+    # This test has Tini spawn a child, and then sends the reload signal. We
+    # expect a new child to take over and the old one to be stopped, and Tini
+    # to then exit with the new child's status.
+    if not args_disabled:
+        print("Running reload test")
+        p = subprocess.Popen(
+            [tini, "-r", "SIGHUP", "-R", "1", os.path.join(src, "test", "signals", "test.py")],
+            universal_newlines=True,
+        )
+
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) > 1, 10)
+        old_children = [c.pid for c in psutil.Process(p.pid).children()]
+        p.send_signal(signal.SIGHUP)
+        busy_wait(
+            lambda: len(psutil.Process(p.pid).children()) == 1
+            and psutil.Process(p.pid).children()[0].pid not in old_children,
+            10,
+        )
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) > 1, 10)
+        p.send_signal(signal.SIGTERM)
+        ret = p.wait()
+        assert ret == 128 + signal.SIGTERM, "Reload test failed (ret was {0})".format(ret)
+
+        # An old instance that ignores the stop signal must be killed once
+        # the grace period is over.
+        print("Running reload escalation test")
+        p = subprocess.Popen(
+            [tini, "-r", "SIGHUP", "-R", "1", "-k", "1", "--", "sh", "-c", "trap '' TERM; trap 'exit 0' USR1; while true; do sleep 0.1; done"],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: len(psutil.Process(p.pid).children()) == 1, 10)
+        old_child = psutil.Process(p.pid).children()[0].pid
+        p.send_signal(signal.SIGHUP)
+        busy_wait(
+            lambda: len(psutil.Process(p.pid).children()) == 1
+            and psutil.Process(p.pid).children()[0].pid != old_child,
+            10,
+        )
+        p.send_signal(signal.SIGUSR1)
+        busy_wait(lambda: p.poll() is not None, 10)
+        assert p.returncode == 0, "Reload escalation test failed (ret was {0})".format(p.returncode)
+
+        # A reload signal that arrives while the child is being terminated
+        # must not start a new instance, or Tini would never exit.
+        print("Running reload termination test")
+        p = subprocess.Popen(
+            [tini, "-r", "SIGHUP", "-R", "5", "--", "sh", "-c", "trap 'sleep 1; exit 0' TERM; while true; do sleep 0.1; done"],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) > 1, 10)
+        p.send_signal(signal.SIGTERM)
+        time.sleep(0.2)
+        p.send_signal(signal.SIGHUP)
+        busy_wait(lambda: p.poll() is not None, 10)
+        assert p.returncode == 0, "Reload termination test failed (ret was {0})".format(p.returncode)
+
+    # Run the signal coalescing test
+    # This test sends a burst of SIGUSR1 to Tini, and expects the child to only
+    # see the first one, and (maybe) one more when the window closes. The child
+    # exits with the number of signals it received.
+    if not args_disabled:
+        print("Running signal coalescing test")
+        p = subprocess.Popen(
+            [tini, "-c", "SIGUSR1:coalesce:1000", os.path.join(src, "test", "coalesce", "stage_1.py")],
+            universal_newlines=True,
+        )
+
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) == 1, 10)
+        time.sleep(0.5)
+        for _ in range(20):
+            p.send_signal(signal.SIGUSR1)
+            time.sleep(0.01)
+        time.sleep(1.5)
+        p.send_signal(signal.SIGTERM)
+        ret = p.wait()
+        assert ret in (1, 2), "Signal coalescing test failed (child got {0} signals)".format(ret)
+
+    # Run the pre-start hooks test
+    # Hook b depends on a, and the main child depends on both having run.
+    if not args_disabled:
+        print("Running pre-start hooks test")
+        d = tempfile.mkdtemp()
+        a, b = os.path.join(d, "a"), os.path.join(d, "b")
+        p = subprocess.Popen(
+            [
+                tini,
+                "-P", "a=touch {0}".format(a),
+                "-P", "b:a=test -f {0} && touch {1}".format(a, b),
+                "-P", "c=true",
+                "--", "test", "-f", b,
+            ],
+            universal_newlines=True,
+        )
+        ret = p.wait()
+        assert ret == 0, "Pre-start hooks test failed (ret was {0})".format(ret)
+
+        print("Running pre-start hooks failure test")
+        p = subprocess.Popen(
+            [tini, "-P", "a=exit 3", "-P", "b:a=true", "--", "true"],
+            stdout=DEVNULL,
+            stderr=DEVNULL,
+            universal_newlines=True,
+        )
+        ret = p.wait()
+        assert ret == 3, "Pre-start hooks failure test failed (ret was {0})".format(ret)
+
+        # A container stopped while hooks run must not start the main child,
+        # even if the hooks handle the signal and succeed.
+        print("Running pre-start hooks termination test")
+        marker = os.path.join(d, "main")
+        p = subprocess.Popen(
+            [tini, "-P", "a=trap 'exit 0' TERM; sleep 10 & wait", "--", "touch", marker],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: len(psutil.Process(p.pid).children(recursive=True)) == 2, 10)
+        p.send_signal(signal.SIGTERM)
+        ret = p.wait()
+        assert ret == 128 + signal.SIGTERM, "Pre-start hooks termination test failed (ret was {0})".format(ret)
+        assert not os.path.exists(marker), "Main child was started after SIGTERM!"
+
+    # Run the max runtime test
+    # The child ignores the stop signal, so Tini has to escalate to SIGKILL.
+    # Remapping the exit code with -e must not hide the timeout.
+    if not args_disabled:
+        print("Running max runtime test")
+        p = subprocess.Popen(
+            [tini, "-t", "1", "-k", "1", "-x", "99", "-e", "137", "--", "sh", "-c", "trap '' TERM; while true; do sleep 1; done"],
+            stdout=DEVNULL,
+            stderr=DEVNULL,
+            universal_newlines=True,
+        )
+        busy_wait(lambda: p.poll() is not None, 10)
+        assert p.returncode == 99, "Max runtime test failed (ret was {0})".format(p.returncode)
+
+    # Run the socket activation test
+    # Tini should only start the child when a connection comes in, stop it
+    # once it's idle, and start it again on the next connection.
+    if not args_disabled:
+        print("Running socket activation test")
+        port = 18080
+
+        def connect_and_get_pid():
+            s = socket.create_connection(("127.0.0.1", port), timeout=10)
+            try:
+                return int(s.recv(16))
+            finally:
+                s.close()
+
+        p = subprocess.Popen(
+            [tini, "-S", "127.0.0.1:{0}".format(port), "-I", "1", os.path.join(src, "test", "activation", "stage_1.py")],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: any(c.laddr.port == port for c in psutil.Process(p.pid).connections()), 10)
+        assert not psutil.Process(p.pid).children(), "Child was started before any connection!"
+
+        first_pid = connect_and_get_pid()
+        busy_wait(lambda: not psutil.Process(p.pid).children(), 10)
+        second_pid = connect_and_get_pid()
+        assert first_pid != second_pid, "Child was not restarted after being idle!"
+
+        p.send_signal(signal.SIGTERM)
+        ret = p.wait()
+        assert ret == 128 + signal.SIGTERM, "Socket activation test failed (ret was {0})".format(ret)
+
+        # Short connections spaced closer than -I must keep the child up, even
+        # though none of them is open when Tini checks for activity.
+        print("Running socket activation short connections test")
+        p = subprocess.Popen(
+            [tini, "-S", "127.0.0.1:{0}".format(port), "-I", "3", os.path.join(src, "test", "activation", "stage_1.py")],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: any(c.laddr.port == port for c in psutil.Process(p.pid).connections()), 10)
+        pids = set()
+        for _ in range(8):
+            pids.add(connect_and_get_pid())
+            time.sleep(1)
+        assert len(pids) == 1, "Child was restarted while connections kept coming in!"
+
+        p.send_signal(signal.SIGTERM)
+        ret = p.wait()
+        assert ret == 128 + signal.SIGTERM, "Socket activation short connections test failed (ret was {0})".format(ret)
+
+        # A SIGTERM that arrives while Tini is stopping an idle child must make
+        # Tini exit, rather than wait for the next connection.
+        print("Running socket activation termination test")
+        p = subprocess.Popen(
+            [tini, "-S", "127.0.0.1:{0}".format(port), "-I", "1", os.path.join(src, "test", "activation", "stage_1.py"), "3"],
+            universal_newlines=True,
+        )
+        busy_wait(lambda: any(c.laddr.port == port for c in psutil.Process(p.pid).connections()), 10)
+        connect_and_get_pid()
+        time.sleep(2.5)  # The idle stop has started, but the child takes 3 seconds to exit.
+        assert psutil.Process(p.pid).children(), "Child exited too early!"
+        p.send_signal(signal.SIGTERM)
+        busy_wait(lambda: p.poll() is not None, 10)
+
     # Run failing test. Force verbosity to 1 so we see the subreaper warning
     # regardless of whether MINIMAL is set.
     print("Running zombie reaping failure test (Tini should warn)")